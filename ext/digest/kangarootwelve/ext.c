@@ -25,6 +25,18 @@
 
 #include <ruby.h>
 #include <ruby/digest.h>
+#include <ruby/thread.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
 
 #include "KangarooTwelve.h"
 #include "utils.h"
@@ -32,6 +44,8 @@
 #define KT_DEFAULT_DIGEST_LENGTH 64 /* 512 bits */
 #define KT_BLOCK_LENGTH 8192 /* chunkSize */
 #define KT_MIN_DIGEST_LENGTH 1
+#define KT_CHAINING_VALUE_LENGTH 32 /* capacityInBytes */
+#define KT_FILE_BUFFER_LENGTH (8 * KT_BLOCK_LENGTH)
 
 #define KT_DIGEST_API_VERSION_IS_SUPPORTED(version) (version == 3)
 
@@ -41,18 +55,27 @@
 
 #define KT_DEBUG(...) fprintf(stderr, __VA_ARGS__)
 
+static ID _id_aref;
+static ID _id_aset;
 static ID _id_auto;
 static ID _id_block_length;
 static ID _id_b;
+static ID _id_bytes;
 static ID _id_customization;
 static ID _id_customization_hex;
 static ID _id_c;
 static ID _id_ch;
 static ID _id_default;
+static ID _id_digest_cache;
 static ID _id_digest_length;
 static ID _id_d;
+static ID _id_entries;
 static ID _id_hexdigest;
+static ID _id_hits;
+static ID _id_length;
+static ID _id_max_bytes;
 static ID _id_metadata;
+static ID _id_misses;
 static ID _id_name;
 static ID _id_new;
 static ID _id_n;
@@ -61,6 +84,7 @@ static ID _id_unpack;
 static VALUE _Digest;
 static VALUE _Digest_KangarooTwelve;
 static VALUE _Digest_KangarooTwelve_Impl;
+static VALUE _Digest_KangarooTwelve_DigestCache;
 static VALUE _Digest_KangarooTwelve_Metadata;
 
 typedef struct {
@@ -142,6 +166,171 @@ static int kangarootwelve_init(void *ctx)
 	return 1;
 }
 
+/*
+ * Computes the chaining value of a leaf chunk whose bytes are the
+ * concatenation of `data` and `tail`.
+ */
+static int compute_chaining_value(const unsigned char *data, size_t length,
+		const unsigned char *tail, size_t tail_length, unsigned char *chaining_value)
+{
+	KeccakWidth1600_12rounds_SpongeInstance leaf;
+
+	return KeccakWidth1600_12rounds_SpongeInitialize(&leaf, 1344, 256) != 0 ||
+			KeccakWidth1600_12rounds_SpongeAbsorb(&leaf, data, length) != 0 ||
+			(tail_length > 0 &&
+					KeccakWidth1600_12rounds_SpongeAbsorb(&leaf, tail, tail_length) != 0) ||
+			KeccakWidth1600_12rounds_SpongeAbsorbLastFewBits(&leaf, 0x0B) != 0 ||
+			KeccakWidth1600_12rounds_SpongeSqueeze(&leaf, chaining_value,
+					KT_CHAINING_VALUE_LENGTH) != 0;
+}
+
+/*
+ * Zero chunks
+ *
+ * Every leaf chunk that consists only of zero bytes has the same chaining
+ * value, so it is computed once and absorbed directly into the final node
+ * instead of permuting the chunk again.  Absorbing chaining values directly
+ * relies on the layout of the instance's queue and final nodes, so it is
+ * checked against KangarooTwelve() during initialization and stays disabled
+ * if the results differ.
+ */
+
+static const unsigned char zero_chunk[KT_BLOCK_LENGTH];
+static unsigned char zero_chunk_chaining_value[KT_CHAINING_VALUE_LENGTH];
+static int chaining_value_absorption_enabled = 0;
+
+static int is_zero_chunk(const unsigned char *data)
+{
+	return memcmp(data, zero_chunk, KT_BLOCK_LENGTH) == 0;
+}
+
+static int is_at_chunk_boundary(KangarooTwelve_Instance *instance)
+{
+	return instance->phase == ABSORBING && instance->blockNumber > 0 &&
+			instance->queueAbsorbedLen == 0;
+}
+
+static int absorb_chaining_value(KangarooTwelve_Instance *instance,
+		const unsigned char *chaining_value)
+{
+	if (KeccakWidth1600_12rounds_SpongeAbsorb(&instance->finalNode, chaining_value,
+			KT_CHAINING_VALUE_LENGTH) != 0)
+		return 1;
+
+	++instance->blockNumber;
+	return 0;
+}
+
+/*
+ * Feeds data until the instance is at a chunk boundary.  The first chunk
+ * belongs to the final node, so the instance only reaches the boundary after
+ * the second chunk.
+ */
+static int align_to_chunk_boundary(KangarooTwelve_Instance *instance, const unsigned char **data,
+		size_t *length)
+{
+	size_t len;
+
+	if (instance->blockNumber == 0) {
+		len = 2 * KT_BLOCK_LENGTH - instance->queueAbsorbedLen;
+	} else if (instance->queueAbsorbedLen != 0) {
+		len = KT_BLOCK_LENGTH - instance->queueAbsorbedLen;
+	} else {
+		return 0;
+	}
+
+	if (len > *length)
+		len = *length;
+
+	if (KangarooTwelve_Update(instance, *data, len) != 0)
+		return 1;
+
+	*data += len;
+	*length -= len;
+	return 0;
+}
+
+static int update_skipping_zero_chunks(KangarooTwelve_Instance *instance,
+		const unsigned char *data, size_t length)
+{
+	const unsigned char *run;
+
+	if (!chaining_value_absorption_enabled || length < KT_BLOCK_LENGTH)
+		return KangarooTwelve_Update(instance, data, length);
+
+	if (align_to_chunk_boundary(instance, &data, &length) != 0)
+		return 1;
+
+	if (!is_at_chunk_boundary(instance))
+		return KangarooTwelve_Update(instance, data, length);
+
+	for (run = data; length >= KT_BLOCK_LENGTH; data += KT_BLOCK_LENGTH, length -= KT_BLOCK_LENGTH) {
+		if (is_zero_chunk(data)) {
+			if (run != data && KangarooTwelve_Update(instance, run, data - run) != 0)
+				return 1;
+
+			if (absorb_chaining_value(instance, zero_chunk_chaining_value) != 0)
+				return 1;
+
+			run = data + KT_BLOCK_LENGTH;
+		}
+	}
+
+	return KangarooTwelve_Update(instance, run, data - run + length);
+}
+
+static int update_with_zeros(KangarooTwelve_Instance *instance, uint64_t length)
+{
+	size_t len;
+
+	while (length > 0 && !(chaining_value_absorption_enabled && is_at_chunk_boundary(instance))) {
+		len = KT_BLOCK_LENGTH - instance->queueAbsorbedLen % KT_BLOCK_LENGTH;
+
+		if (len > length)
+			len = (size_t)length;
+
+		if (KangarooTwelve_Update(instance, zero_chunk, len) != 0)
+			return 1;
+
+		length -= len;
+	}
+
+	for (; length >= KT_BLOCK_LENGTH; length -= KT_BLOCK_LENGTH) {
+		if (absorb_chaining_value(instance, zero_chunk_chaining_value) != 0)
+			return 1;
+	}
+
+	return length > 0 ? KangarooTwelve_Update(instance, zero_chunk, (size_t)length) : 0;
+}
+
+static void init_chaining_value_absorption(void)
+{
+	KangarooTwelve_Instance instance;
+	unsigned char *zeros, expected[32], actual[32];
+	const size_t test_length = 4 * KT_BLOCK_LENGTH + 1;
+	int failed;
+
+	if (compute_chaining_value(zero_chunk, KT_BLOCK_LENGTH, NULL, 0,
+			zero_chunk_chaining_value) != 0)
+		return;
+
+	zeros = ALLOC_N(unsigned char, test_length);
+	memset(zeros, 0, test_length);
+	failed = KangarooTwelve(zeros, test_length, expected, sizeof(expected), 0, 0) != 0;
+	xfree(zeros);
+
+	if (failed)
+		return;
+
+	chaining_value_absorption_enabled = 1;
+
+	if (KangarooTwelve_Initialize(&instance, sizeof(actual)) != 0 ||
+			update_with_zeros(&instance, test_length) != 0 ||
+			KangarooTwelve_Final(&instance, actual, 0, 0) != 0 ||
+			memcmp(expected, actual, sizeof(expected)) != 0)
+		chaining_value_absorption_enabled = 0;
+}
+
 static void kangarootwelve_update(void *ctx, unsigned char *data, size_t length)
 {
 	if (ctx == NULL)
@@ -150,7 +339,7 @@ static void kangarootwelve_update(void *ctx, unsigned char *data, size_t length)
 	if (data == NULL)
 		rb_raise(rb_eRuntimeError, "Data pointer is NULL.");
 
-	if (KangarooTwelve_Update(&KT_CONTEXT_PTR(ctx)->instance, data, length) != 0)
+	if (update_skipping_zero_chunks(&KT_CONTEXT_PTR(ctx)->instance, data, length) != 0)
 		rb_raise(rb_eRuntimeError, "Hash update failed.");
 }
 
@@ -537,165 +726,1788 @@ static VALUE _Digest_KangarooTwelve_Impl_singleton_customization_hex(VALUE self)
 }
 
 /*
- * call-seq: customization -> string or nil
- *
- * Returns configured customization string of the implementation object.
+ * Object hashing
  */
-static VALUE _Digest_KangarooTwelve_Impl_customization(VALUE self)
+
+#define KT_OBJECT_STAGING_LENGTH 256
+#define KT_OBJECT_MAX_DEPTH 512
+
+#define KT_OBJECT_TAG_NIL 'N'
+#define KT_OBJECT_TAG_FALSE 'F'
+#define KT_OBJECT_TAG_TRUE 'T'
+#define KT_OBJECT_TAG_INTEGER 'I'
+#define KT_OBJECT_TAG_FLOAT 'D'
+#define KT_OBJECT_TAG_STRING 'S'
+#define KT_OBJECT_TAG_SYMBOL 'Y'
+#define KT_OBJECT_TAG_ARRAY 'A'
+#define KT_OBJECT_TAG_HASH 'H'
+
+typedef struct {
+	KangarooTwelve_Instance *instance;
+	VALUE buffer;
+	size_t staged;
+	unsigned char staging[KT_OBJECT_STAGING_LENGTH];
+} kangarootwelve_object_encoder_t;
+
+typedef struct {
+	VALUE encoded_key;
+	VALUE value;
+} kangarootwelve_object_pair_t;
+
+static void get_impl_class_params(VALUE klass, int *digest_length, VALUE *customization)
 {
-	VALUE customization;
+	VALUE digest_length_value;
 
-	if (rb_ivar_defined(self, _id_customization)) {
-		customization = rb_ivar_get(self, _id_customization);
+	if (klass == _Digest_KangarooTwelve_Impl)
+		rb_raise(rb_eRuntimeError, "Digest::KangarooTwelve::Impl is an abstract class.");
+
+	digest_length_value = rb_ivar_get(klass, _id_digest_length);
+
+	if (TYPE(digest_length_value) != T_FIXNUM)
+		rb_raise(rb_eTypeError, "Invalid object type for digest length.");
+
+	*digest_length = FIX2INT(digest_length_value);
+	check_digest_length(*digest_length);
+	*customization = rb_ivar_get(klass, _id_customization);
+
+	if (TYPE(*customization) != T_NIL && TYPE(*customization) != T_STRING)
+		rb_raise(rb_eTypeError, "Invalid object type for a customization string.");
+}
+
+static void object_encoder_flush(kangarootwelve_object_encoder_t *encoder)
+{
+	if (encoder->staged == 0)
+		return;
+
+	if (NIL_P(encoder->buffer)) {
+		if (KangarooTwelve_Update(encoder->instance, encoder->staging, encoder->staged) != 0)
+			rb_raise(rb_eRuntimeError, "Hash update failed.");
 	} else {
-		VALUE klass = rb_obj_class(self);
-		customization = rb_ivar_get(klass, _id_customization);
-		rb_ivar_set(self, _id_customization, customization);
+		rb_str_cat(encoder->buffer, (const char *)encoder->staging, encoder->staged);
 	}
 
-	return customization;
+	encoder->staged = 0;
 }
 
-/*
- * call-seq: customization_hex -> string or nil
- *
- * Returns configured customization string of the implementation object in hex.
- */
-static VALUE _Digest_KangarooTwelve_Impl_customization_hex(VALUE self)
+static void object_encoder_write(kangarootwelve_object_encoder_t *encoder,
+		const unsigned char *data, size_t length)
 {
-	VALUE customization = rb_funcall(self, _id_customization, 0);
-	return hex_encode_str(customization);
+	if (encoder->staged + length <= KT_OBJECT_STAGING_LENGTH) {
+		memcpy(encoder->staging + encoder->staged, data, length);
+		encoder->staged += length;
+		return;
+	}
+
+	object_encoder_flush(encoder);
+
+	if (length <= KT_OBJECT_STAGING_LENGTH) {
+		memcpy(encoder->staging, data, length);
+		encoder->staged = length;
+	} else if (NIL_P(encoder->buffer)) {
+		if (KangarooTwelve_Update(encoder->instance, data, length) != 0)
+			rb_raise(rb_eRuntimeError, "Hash update failed.");
+	} else {
+		rb_str_cat(encoder->buffer, (const char *)data, length);
+	}
 }
 
-/*
- * call-seq: inspect -> string
- *
- * Returns a string in the form of #<impl_class_name|digest_length|hex_cust_string|hex_digest>
- */
-static VALUE _Digest_KangarooTwelve_Impl_inspect(VALUE self)
+static void object_encoder_write_header(kangarootwelve_object_encoder_t *encoder,
+		unsigned char tag, uint64_t length)
 {
-	VALUE klass, klass_name, digest_length, customization_hex, hexdigest, args[4];
+	unsigned char header[9];
+	int i;
 
-	klass = rb_obj_class(self);
-	klass_name = rb_class_name(klass);
+	header[0] = tag;
 
-	if (klass_name == Qnil)
-		klass_name = rb_inspect(klass);
+	for (i = 8; i > 0; --i) {
+		header[i] = (unsigned char)(length & 0xff);
+		length >>= 8;
+	}
 
-	digest_length = rb_funcall(self, _id_digest_length, 0);
-	customization_hex = rb_funcall(self, _id_customization_hex, 0);
-	hexdigest = rb_funcall(self, _id_hexdigest, 0);
+	object_encoder_write(encoder, header, sizeof(header));
+}
 
-	args[0] = klass_name;
-	args[1] = digest_length;
-	args[2] = customization_hex;
-	args[3] = hexdigest;
-	return rb_str_format(sizeof(args), args, rb_str_new_literal("#<%s:%d|%s|%s>"));
+static void object_encoder_write_integer(kangarootwelve_object_encoder_t *encoder, VALUE obj)
+{
+	unsigned char local[64], *magnitude, sign;
+	size_t length;
+	VALUE tmp = 0;
+
+	length = rb_absint_size(obj, NULL);
+	magnitude = length <= sizeof(local) ? local : ALLOCV_N(unsigned char, tmp, length);
+	sign = rb_integer_pack(obj, magnitude, length, 1, 0, INTEGER_PACK_BIG_ENDIAN) < 0;
+	object_encoder_write_header(encoder, KT_OBJECT_TAG_INTEGER, length);
+	object_encoder_write(encoder, &sign, 1);
+	object_encoder_write(encoder, magnitude, length);
+
+	if (tmp)
+		ALLOCV_END(tmp);
 }
 
-/*
- * Init
- */
+static void object_encoder_write_float(kangarootwelve_object_encoder_t *encoder, double value)
+{
+	unsigned char bytes[9];
+	uint64_t bits;
+	int i;
 
-void Init_kangarootwelve(void)
+	if (isnan(value)) {
+		bits = UINT64_C(0x7ff8000000000000);
+	} else {
+		memcpy(&bits, &value, sizeof(bits));
+	}
+
+	bytes[0] = KT_OBJECT_TAG_FLOAT;
+
+	for (i = 8; i > 0; --i) {
+		bytes[i] = (unsigned char)(bits & 0xff);
+		bits >>= 8;
+	}
+
+	object_encoder_write(encoder, bytes, sizeof(bytes));
+}
+
+static void object_encoder_write_object(kangarootwelve_object_encoder_t *encoder, VALUE obj,
+		int depth);
+
+static int collect_hash_pair(VALUE key, VALUE value, VALUE pairs)
 {
-	#define DEFINE_ID(x) _id_##x = rb_intern_const(#x);
+	rb_ary_push(pairs, key);
+	rb_ary_push(pairs, value);
+	return ST_CONTINUE;
+}
 
-	DEFINE_ID(auto)
-	DEFINE_ID(block_length)
-	DEFINE_ID(b)
-	DEFINE_ID(ch)
-	DEFINE_ID(customization)
-	DEFINE_ID(customization_hex)
-	DEFINE_ID(c)
-	DEFINE_ID(default)
-	DEFINE_ID(digest_length)
-	DEFINE_ID(d)
-	DEFINE_ID(hexdigest)
-	DEFINE_ID(metadata)
-	DEFINE_ID(name)
-	DEFINE_ID(new)
-	DEFINE_ID(n)
-	DEFINE_ID(unpack)
+static int compare_object_pairs(const void *a, const void *b)
+{
+	VALUE x = ((const kangarootwelve_object_pair_t *)a)->encoded_key;
+	VALUE y = ((const kangarootwelve_object_pair_t *)b)->encoded_key;
+	long x_len = RSTRING_LEN(x), y_len = RSTRING_LEN(y);
+	int cmp = memcmp(RSTRING_PTR(x), RSTRING_PTR(y), x_len < y_len ? x_len : y_len);
 
-	rb_require("digest");
-	_Digest = rb_path2class("Digest");
+	if (cmp != 0)
+		return cmp;
 
-	#if 0
-	/* Tell RDoc about Digest since it doesn't recognize rb_path2class. */
-	_Digest = rb_define_module("Digest");
-	#endif
+	return x_len < y_len ? -1 : x_len > y_len;
+}
 
-	/*
-	 * Document-module: Digest::KangarooTwelve
-	 */
+static void object_encoder_write_hash(kangarootwelve_object_encoder_t *encoder, VALUE hash,
+		int depth)
+{
+	kangarootwelve_object_encoder_t key_encoder;
+	kangarootwelve_object_pair_t *pairs;
+	VALUE collected, tmp;
+	long count, i;
+
+	count = RHASH_SIZE(hash);
+	object_encoder_write_header(encoder, KT_OBJECT_TAG_HASH, count);
+
+	if (count == 0)
+		return;
+
+	collected = rb_ary_new_capa(count * 4);
+	rb_hash_foreach(hash, collect_hash_pair, collected);
+
+	if (RARRAY_LEN(collected) != count * 2)
+		rb_raise(rb_eRuntimeError, "Hash was modified during object hashing.");
+
+	pairs = ALLOCV_N(kangarootwelve_object_pair_t, tmp, count);
+	key_encoder.instance = NULL;
+
+	for (i = 0; i < count; ++i) {
+		key_encoder.buffer = rb_str_buf_new(KT_OBJECT_STAGING_LENGTH);
+		key_encoder.staged = 0;
+		object_encoder_write_object(&key_encoder, RARRAY_AREF(collected, i * 2), depth + 1);
+		object_encoder_flush(&key_encoder);
+		rb_ary_push(collected, key_encoder.buffer);
+		pairs[i].encoded_key = key_encoder.buffer;
+		pairs[i].value = RARRAY_AREF(collected, i * 2 + 1);
+	}
 
-	_Digest_KangarooTwelve = rb_define_module_under(_Digest, "KangarooTwelve");
+	qsort(pairs, count, sizeof(*pairs), compare_object_pairs);
 
-	rb_define_singleton_method(_Digest_KangarooTwelve, "default",
-			_Digest_KangarooTwelve_singleton_default, 0);
-	rb_define_singleton_method(_Digest_KangarooTwelve, "implement",
-			_Digest_KangarooTwelve_singleton_implement, -1);
-	rb_define_singleton_method(_Digest_KangarooTwelve, "[]",
-			_Digest_KangarooTwelve_singleton_implement_simple, 1);
+	for (i = 0; i < count; ++i) {
+		if (i > 0 && compare_object_pairs(&pairs[i - 1], &pairs[i]) == 0)
+			rb_raise(rb_eArgError, "Hash contains keys with identical canonical encodings.");
 
-	/*
-	 * Document-const: Digest::KangarooTwelve::BLOCK_LENGTH
-	 *
-	 * 8192 bytes
-	 */
+		object_encoder_write(encoder, _RSTRING_PTR_U(pairs[i].encoded_key),
+				RSTRING_LEN(pairs[i].encoded_key));
+		object_encoder_write_object(encoder, pairs[i].value, depth + 1);
+	}
 
-	/* 8192 bytes */
+	ALLOCV_END(tmp);
+	RB_GC_GUARD(collected);
+}
 
-	rb_define_const(_Digest_KangarooTwelve, "BLOCK_LENGTH", INT2FIX(KT_BLOCK_LENGTH));
+static void object_encoder_write_object(kangarootwelve_object_encoder_t *encoder, VALUE obj,
+		int depth)
+{
+	unsigned char tag;
+	VALUE str;
+	long i;
 
-	/*
-	 * Document-const: Digest::KangarooTwelve::DEFAULT_DIGEST_LENGTH
-	 *
-	 * 64 bytes (512 bits)
-	 */
+	if (depth > KT_OBJECT_MAX_DEPTH)
+		rb_raise(rb_eArgError, "Object nesting is too deep (more than %d levels).",
+				KT_OBJECT_MAX_DEPTH);
 
-	/* 64 bytes (512 bits) */
+	switch (TYPE(obj)) {
+	case T_NIL:
+		tag = KT_OBJECT_TAG_NIL;
+		object_encoder_write(encoder, &tag, 1);
+		break;
+	case T_FALSE:
+		tag = KT_OBJECT_TAG_FALSE;
+		object_encoder_write(encoder, &tag, 1);
+		break;
+	case T_TRUE:
+		tag = KT_OBJECT_TAG_TRUE;
+		object_encoder_write(encoder, &tag, 1);
+		break;
+	case T_FIXNUM:
+	case T_BIGNUM:
+		object_encoder_write_integer(encoder, obj);
+		break;
+	case T_FLOAT:
+		object_encoder_write_float(encoder, RFLOAT_VALUE(obj));
+		break;
+	case T_STRING:
+		object_encoder_write_header(encoder, KT_OBJECT_TAG_STRING, RSTRING_LEN(obj));
+		object_encoder_write(encoder, _RSTRING_PTR_U(obj), RSTRING_LEN(obj));
+		break;
+	case T_SYMBOL:
+		str = rb_sym2str(obj);
+		object_encoder_write_header(encoder, KT_OBJECT_TAG_SYMBOL, RSTRING_LEN(str));
+		object_encoder_write(encoder, _RSTRING_PTR_U(str), RSTRING_LEN(str));
+		break;
+	case T_ARRAY:
+		object_encoder_write_header(encoder, KT_OBJECT_TAG_ARRAY, RARRAY_LEN(obj));
 
-	rb_define_const(_Digest_KangarooTwelve, "DEFAULT_DIGEST_LENGTH",
-			INT2FIX(KT_DEFAULT_DIGEST_LENGTH));
+		for (i = 0; i < RARRAY_LEN(obj); ++i)
+			object_encoder_write_object(encoder, RARRAY_AREF(obj, i), depth + 1);
 
-	/*
-	 * Document-class: Digest::KangarooTwelve::Impl
-	 */
+		break;
+	case T_HASH:
+		object_encoder_write_hash(encoder, obj, depth);
+		break;
+	default:
+		rb_raise(rb_eTypeError, "Unsupported object type for object hashing: %s",
+				rb_obj_classname(obj));
+	}
+}
 
-	_Digest_KangarooTwelve_Impl = rb_define_class_under(_Digest_KangarooTwelve, "Impl",
-			rb_path2class("Digest::Base"));
+/*
+ * call-seq: digest_object(obj) -> string
+ *
+ * Returns the digest of a canonical encoding of +obj+ without serializing it
+ * into an intermediate string first.  The digest uses the digest length and
+ * customization string of the implementation class.
+ *
+ * +obj+ can be +nil+, +true+, +false+, an Integer, a Float, a String, a
+ * Symbol, or an Array or a Hash that contains only such objects.  Other
+ * object types raise a TypeError.
+ *
+ * Each object is encoded as a one-byte tag, and integers specifying lengths
+ * or counts are encoded as 8-byte unsigned big-endian values (+u64+):
+ *
+ * nil ::     <tt>"N"</tt>
+ * false ::   <tt>"F"</tt>
+ * true ::    <tt>"T"</tt>
+ * Integer :: <tt>"I"</tt>, +u64+ byte length of the magnitude, a sign byte
+ *            (+0+ if non-negative, +1+ if negative), and the magnitude in
+ *            minimal big-endian bytes (no bytes for zero)
+ * Float ::   <tt>"D"</tt> and the 8-byte big-endian IEEE 754 binary64 value;
+ *            NaN is always encoded as +7ff8000000000000+
+ * String ::  <tt>"S"</tt>, +u64+ byte length, and the raw bytes regardless of
+ *            encoding
+ * Symbol ::  <tt>"Y"</tt>, +u64+ byte length, and the raw bytes of its name
+ * Array ::   <tt>"A"</tt>, +u64+ element count, and the encoded elements
+ * Hash ::    <tt>"H"</tt>, +u64+ pair count, and each encoded key followed by
+ *            its encoded value, ordered by the bytewise comparison of the
+ *            encoded keys
+ *
+ * The digest is the same as the one produced by digesting the encoded bytes
+ * with the implementation class.  Hashes with two keys that have the same
+ * encoding raise an ArgumentError, and so does nesting deeper than 512
+ * levels.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_digest_object(VALUE self, VALUE obj)
+{
+	kangarootwelve_object_encoder_t encoder;
+	KangarooTwelve_Instance instance;
+	VALUE customization, digest;
+	int digest_length;
 
-	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "new",
-			_Digest_KangarooTwelve_Impl_singleton_new, 0);
-	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "block_length",
-			_Digest_KangarooTwelve_Impl_singleton_block_length, 0);
-	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest_length",
-			_Digest_KangarooTwelve_Impl_singleton_digest_length, 0);
-	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "customization",
-			_Digest_KangarooTwelve_Impl_singleton_customization, 0);
-	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "customization_hex",
-			_Digest_KangarooTwelve_Impl_singleton_customization_hex, 0);
+	get_impl_class_params(self, &digest_length, &customization);
 
-	rb_define_method(_Digest_KangarooTwelve_Impl, "customization",
-			_Digest_KangarooTwelve_Impl_customization, 0);
-	rb_define_method(_Digest_KangarooTwelve_Impl, "customization_hex",
-			_Digest_KangarooTwelve_Impl_customization_hex, 0);
-	rb_define_method(_Digest_KangarooTwelve_Impl, "inspect",
-			_Digest_KangarooTwelve_Impl_inspect, 0);
+	if (KangarooTwelve_Initialize(&instance, digest_length) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to initialize hash data instance.");
 
-	/*
-	 * Document-class: Digest::KangarooTwelve::Metadata
-	 *
-	 * This class represents the internal metadata produced for the
-	 * implementation classes.
-	 */
+	encoder.instance = &instance;
+	encoder.buffer = Qnil;
+	encoder.staged = 0;
+	object_encoder_write_object(&encoder, obj, 0);
+	object_encoder_flush(&encoder);
 
-	_Digest_KangarooTwelve_Metadata = rb_define_class_under(_Digest_KangarooTwelve, "Metadata",
-			rb_cObject);
+	digest = rb_str_new(0, digest_length);
 
-	rb_undef_alloc_func(_Digest_KangarooTwelve_Metadata);
+	if (KangarooTwelve_Final(&instance, _RSTRING_PTR_U(digest),
+			NIL_P(customization) ? NULL : _RSTRING_PTR_U(customization),
+			NIL_P(customization) ? 0 : RSTRING_LEN(customization)) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to finalize hash.");
+
+	return digest;
+}
+
+/*
+ * 64-bit hashing
+ */
+
+#define KT_HASH64_LENGTH 8
+#define KT_HASH64_MASK ((1ULL << 62) - 1)
+
+static void hash64_init(KangarooTwelve_Instance *instance, VALUE str, VALUE customization)
+{
+	if (KangarooTwelve_Initialize(instance, 0) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to initialize hash data instance.");
+
+	if (KangarooTwelve_Update(instance, _RSTRING_PTR_U(str), RSTRING_LEN(str)) != 0)
+		rb_raise(rb_eRuntimeError, "Hash update failed.");
+
+	if (KangarooTwelve_Final(instance, NULL,
+			NIL_P(customization) ? NULL : _RSTRING_PTR_U(customization),
+			NIL_P(customization) ? 0 : RSTRING_LEN(customization)) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to finalize hash.");
+}
+
+/*
+ * Reads 8 bytes as a little-endian integer and keeps its lower 62 bits, so
+ * the result is always a Fixnum on 64-bit platforms.
+ */
+static VALUE hash64_value(const unsigned char *bytes)
+{
+	uint64_t value = 0;
+	int i;
+
+	for (i = KT_HASH64_LENGTH; i > 0; --i)
+		value = value << 8 | bytes[i - 1];
+
+	return ULL2NUM(value & KT_HASH64_MASK);
+}
+
+static VALUE hash64_squeeze(KangarooTwelve_Instance *instance)
+{
+	unsigned char bytes[KT_HASH64_LENGTH];
+
+	if (KangarooTwelve_Squeeze(instance, bytes, sizeof(bytes)) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to squeeze hash.");
+
+	return hash64_value(bytes);
+}
+
+/*
+ * call-seq: hash64(string) -> integer
+ *
+ * Returns the first 8 bytes of the digest of +string+ as a little-endian
+ * integer with its two most significant bits cleared.  This is the same as
+ * <tt>digest(string).unpack1("Q<") & (2**62 - 1)</tt> but doesn't create a
+ * hashing object or a digest string.  The result fits in a Fixnum on 64-bit
+ * platforms, so no object is allocated either.
+ *
+ * The customization string of the implementation class is used, but its
+ * digest length is ignored.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_hash64(VALUE self, VALUE str)
+{
+	KangarooTwelve_Instance instance;
+	VALUE customization;
+	int digest_length;
+
+	StringValue(str);
+	get_impl_class_params(self, &digest_length, &customization);
+	hash64_init(&instance, str, customization);
+	return hash64_squeeze(&instance);
+}
+
+/*
+ * call-seq: hash64_many(array) -> array
+ *
+ * Returns an array of the results of ::hash64 for each string in +array+.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_hash64_many(VALUE self, VALUE array)
+{
+	KangarooTwelve_Instance instance;
+	VALUE results, str, customization;
+	int digest_length;
+	long i;
+
+	Check_Type(array, T_ARRAY);
+	get_impl_class_params(self, &digest_length, &customization);
+	results = rb_ary_new_capa(RARRAY_LEN(array));
+
+	for (i = 0; i < RARRAY_LEN(array); ++i) {
+		str = RARRAY_AREF(array, i);
+		StringValue(str);
+		hash64_init(&instance, str, customization);
+		rb_ary_push(results, hash64_squeeze(&instance));
+	}
+
+	return results;
+}
+
+/*
+ * call-seq:
+ *   hash64_k(string, k) { |integer| ... } -> nil
+ *   hash64_k(string, k) -> array
+ *
+ * Squeezes <tt>8 * k</tt> bytes of output for +string+ at once, and yields
+ * or returns them as +k+ integers in the same form as the result of ::hash64.
+ * The first integer is the same as the result of ::hash64.
+ *
+ * This is meant for deriving the +k+ indices of a Bloom filter.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_hash64_k(VALUE self, VALUE str, VALUE k)
+{
+	KangarooTwelve_Instance instance;
+	VALUE results = Qnil, customization, bytes_tmp;
+	unsigned char *bytes;
+	int digest_length;
+	long count, i;
+
+	StringValue(str);
+	count = NUM2LONG(k);
+
+	if (count < 0)
+		rb_raise(rb_eArgError, "Negative count: %ld", count);
+
+	if ((unsigned long)count > SIZE_MAX / KT_HASH64_LENGTH)
+		rb_raise(rb_eArgError, "Count too large: %ld", count);
+
+	get_impl_class_params(self, &digest_length, &customization);
+	hash64_init(&instance, str, customization);
+	bytes = ALLOCV_N(unsigned char, bytes_tmp, (size_t)count * KT_HASH64_LENGTH);
+
+	if (KangarooTwelve_Squeeze(&instance, bytes, (size_t)count * KT_HASH64_LENGTH) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to squeeze hash.");
+
+	if (!rb_block_given_p())
+		results = rb_ary_new_capa(count);
+
+	for (i = 0; i < count; ++i) {
+		if (NIL_P(results)) {
+			rb_yield(hash64_value(bytes + i * KT_HASH64_LENGTH));
+		} else {
+			rb_ary_push(results, hash64_value(bytes + i * KT_HASH64_LENGTH));
+		}
+	}
+
+	ALLOCV_END(bytes_tmp);
+	return results;
+}
+
+/*
+ * Multiple outputs
+ */
+
+static VALUE lookup_output_option(VALUE spec, ID long_name, ID short_name)
+{
+	VALUE value = rb_hash_lookup2(spec, ID2SYM(long_name), Qundef);
+	return value == Qundef ? rb_hash_lookup2(spec, ID2SYM(short_name), Qundef) : value;
+}
+
+static void parse_output_spec(VALUE spec, int *digest_length, VALUE *customization)
+{
+	VALUE length, customization_hex;
+
+	if (TYPE(spec) != T_HASH)
+		rb_raise(rb_eTypeError, "Output specification not a hash.");
+
+	length = lookup_output_option(spec, _id_length, _id_d);
+
+	if (length == Qundef)
+		length = rb_hash_lookup2(spec, ID2SYM(_id_digest_length), Qundef);
+
+	if (length != Qundef) {
+		if (TYPE(length) != T_FIXNUM)
+			rb_raise(rb_eTypeError, "Invalid value type for digest length.");
+
+		*digest_length = FIX2INT(length);
+		check_digest_length(*digest_length);
+	}
+
+	*customization = lookup_output_option(spec, _id_customization, _id_c);
+
+	if (*customization == Qundef) {
+		customization_hex = lookup_output_option(spec, _id_customization_hex, _id_ch);
+
+		if (customization_hex == Qundef) {
+			*customization = Qundef;
+		} else if (NIL_P(customization_hex)) {
+			*customization = Qnil;
+		} else {
+			if (TYPE(customization_hex) != T_STRING)
+				rb_raise(rb_eTypeError, "Customization argument not a string.");
+
+			*customization = hex_decode_str(customization_hex);
+		}
+	}
+
+	if (*customization != Qundef && TYPE(*customization) != T_NIL &&
+			TYPE(*customization) != T_STRING)
+		rb_raise(rb_eTypeError, "Invalid value type for customization string.");
+}
+
+/*
+ * Finalizes a copy of the instance for each output specification.  Options
+ * not in a specification default to those of the implementation class.
+ */
+static VALUE finish_multi(KangarooTwelve_Instance *instance, VALUE specs, int default_length,
+		VALUE default_customization)
+{
+	KangarooTwelve_Instance copy;
+	VALUE results, customization, digest;
+	int digest_length;
+	long i;
+
+	Check_Type(specs, T_ARRAY);
+	results = rb_ary_new_capa(RARRAY_LEN(specs));
+
+	for (i = 0; i < RARRAY_LEN(specs); ++i) {
+		digest_length = default_length;
+		parse_output_spec(RARRAY_AREF(specs, i), &digest_length, &customization);
+
+		if (customization == Qundef)
+			customization = default_customization;
+
+		copy = *instance;
+		copy.fixedOutputLength = 0;
+		digest = rb_str_new(0, digest_length);
+
+		if (KangarooTwelve_Final(&copy, NULL,
+				NIL_P(customization) ? NULL : _RSTRING_PTR_U(customization),
+				NIL_P(customization) ? 0 : RSTRING_LEN(customization)) != 0 ||
+				KangarooTwelve_Squeeze(&copy, _RSTRING_PTR_U(digest), digest_length) != 0)
+			rb_raise(rb_eRuntimeError, "Failed to finalize hash.");
+
+		rb_ary_push(results, digest);
+	}
+
+	return results;
+}
+
+/*
+ * call-seq: digest_multi(string, [{ customization: string or nil, length: int }, ...]) -> array
+ *
+ * Absorbs +string+ once and returns its digests for each of the output
+ * specifications.
+ *
+ * A specification can have the same customization options as
+ * Digest::KangarooTwelve.implement, and the digest length as +:length+,
+ * +:digest_length+ or +:d+.  Options that aren't specified default to those
+ * of the implementation class.
+ *
+ * Example:
+ *
+ * <tt>Digest::KangarooTwelve[32].digest_multi("abc", [{}, { length: 64 }, { c: "key" }])</tt>
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_digest_multi(VALUE self, VALUE str,
+		VALUE specs)
+{
+	KangarooTwelve_Instance instance;
+	VALUE customization;
+	int digest_length;
+
+	get_impl_class_params(self, &digest_length, &customization);
+	StringValue(str);
+
+	if (KangarooTwelve_Initialize(&instance, digest_length) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to initialize hash data instance.");
+
+	if (update_skipping_zero_chunks(&instance, _RSTRING_PTR_U(str), RSTRING_LEN(str)) != 0)
+		rb_raise(rb_eRuntimeError, "Hash update failed.");
+
+	return finish_multi(&instance, specs, digest_length, customization);
+}
+
+/*
+ * Digest cache
+ *
+ * Entries are kept in a doubly linked list ordered from the most recently
+ * used, and are found through an ObjectSpace::WeakMap keyed by the identity
+ * of the frozen strings.  The cache marks the entries in the list, so an
+ * entry only goes away once it's unlinked.  A second WeakMap maps each entry
+ * back to its string, and entries whose strings were collected are unlinked
+ * by a sweep that runs on the next insertion after a garbage collection.
+ *
+ * Unlinked entries stay in the maps until they are collected, and are reused
+ * if their strings are looked up again before that.
+ *
+ * All bookkeeping happens while holding the GVL.  Calls into the maps don't
+ * run Ruby code, so the list doesn't change while it's being walked.
+ */
+
+typedef struct kangarootwelve_cache_entry {
+	struct kangarootwelve_cache_entry *prev;
+	struct kangarootwelve_cache_entry *next;
+	VALUE self;
+	VALUE digest;
+	size_t bytes;
+	int linked;
+} kangarootwelve_cache_entry_t;
+
+typedef struct {
+	kangarootwelve_cache_entry_t *head;
+	kangarootwelve_cache_entry_t *tail;
+	VALUE map;
+	VALUE keys;
+	size_t gc_count;
+	size_t max_bytes;
+	size_t bytes;
+	size_t entries;
+	size_t hits;
+	size_t misses;
+} kangarootwelve_cache_t;
+
+static void cache_entry_mark(void *ptr)
+{
+	rb_gc_mark(((kangarootwelve_cache_entry_t *)ptr)->digest);
+}
+
+static const rb_data_type_t cache_entry_type = {
+	"digest/kangarootwelve/cache_entry",
+	{ cache_entry_mark, RUBY_TYPED_DEFAULT_FREE, 0, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void cache_mark(void *ptr)
+{
+	kangarootwelve_cache_t *cache = ptr;
+	kangarootwelve_cache_entry_t *entry;
+
+	rb_gc_mark(cache->map);
+	rb_gc_mark(cache->keys);
+
+	for (entry = cache->head; entry != NULL; entry = entry->next)
+		rb_gc_mark(entry->self);
+}
+
+static const rb_data_type_t cache_type = {
+	"digest/kangarootwelve/cache",
+	{ cache_mark, RUBY_TYPED_DEFAULT_FREE, 0, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void cache_unlink(kangarootwelve_cache_t *cache, kangarootwelve_cache_entry_t *entry)
+{
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void cache_push_front(kangarootwelve_cache_t *cache, kangarootwelve_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if (cache->head != NULL) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+
+	cache->head = entry;
+}
+
+static void cache_evict(kangarootwelve_cache_t *cache, kangarootwelve_cache_entry_t *entry)
+{
+	cache_unlink(cache, entry);
+	cache->bytes -= entry->bytes;
+	--cache->entries;
+	entry->linked = 0;
+	entry->digest = Qnil;
+}
+
+static void cache_shrink(kangarootwelve_cache_t *cache, size_t max_bytes)
+{
+	while (cache->tail != NULL && cache->bytes > max_bytes)
+		cache_evict(cache, cache->tail);
+}
+
+/*
+ * Evicts the entries whose strings were garbage-collected.  A string can only
+ * die during a garbage collection, so the list is only walked once after each.
+ */
+static void cache_sweep(kangarootwelve_cache_t *cache)
+{
+	kangarootwelve_cache_entry_t *entry, *next;
+	size_t gc_count = rb_gc_count();
+
+	if (gc_count == cache->gc_count)
+		return;
+
+	cache->gc_count = gc_count;
+
+	for (entry = cache->head; entry != NULL; entry = next) {
+		next = entry->next;
+
+		if (NIL_P(rb_funcall(cache->keys, _id_aref, 1, entry->self)))
+			cache_evict(cache, entry);
+	}
+}
+
+static VALUE get_cache(VALUE klass)
+{
+	if (rb_ivar_defined(klass, _id_digest_cache) != Qtrue)
+		return Qnil;
+
+	return rb_ivar_get(klass, _id_digest_cache);
+}
+
+/*
+ * Returns the entry of +str+, which is either linked or waiting to be
+ * collected after an eviction, or NULL if there's none.
+ */
+static kangarootwelve_cache_entry_t *cache_lookup(kangarootwelve_cache_t *cache, VALUE str)
+{
+	VALUE entry_obj = rb_funcall(cache->map, _id_aref, 1, str);
+	return NIL_P(entry_obj) ? NULL : rb_check_typeddata(entry_obj, &cache_entry_type);
+}
+
+static void cache_insert(kangarootwelve_cache_t *cache, VALUE str, VALUE digest)
+{
+	kangarootwelve_cache_entry_t *entry;
+	VALUE entry_obj;
+	size_t bytes = RSTRING_LEN(digest) + sizeof(kangarootwelve_cache_entry_t);
+
+	if (bytes > cache->max_bytes)
+		return;
+
+	cache_sweep(cache);
+	entry = cache_lookup(cache, str);
+
+	if (entry == NULL) {
+		entry_obj = TypedData_Make_Struct(0, kangarootwelve_cache_entry_t, &cache_entry_type,
+				entry);
+		entry->self = entry_obj;
+		entry->digest = Qnil;
+		rb_funcall(cache->map, _id_aset, 2, str, entry_obj);
+		rb_funcall(cache->keys, _id_aset, 2, entry_obj, str);
+	} else if (entry->linked) {
+		return;
+	}
+
+	entry->digest = rb_str_new_frozen(digest);
+	entry->bytes = bytes;
+	entry->linked = 1;
+	cache_push_front(cache, entry);
+	cache->bytes += bytes;
+	++cache->entries;
+	cache_shrink(cache, cache->max_bytes);
+}
+
+/*
+ * call-seq: digest(string) -> string
+ *
+ * Returns the digest of +string+.
+ *
+ * If the digest cache of the implementation class is enabled and +string+
+ * is frozen, the digest is looked up in the cache first, and is stored there
+ * if not yet found.  Mutable strings never use the cache.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_digest(int argc, VALUE *argv, VALUE self)
+{
+	VALUE cache_obj = get_cache(self);
+	kangarootwelve_cache_t *cache;
+	kangarootwelve_cache_entry_t *entry;
+	VALUE str, digest;
+
+	if (NIL_P(cache_obj) || argc != 1 || TYPE(argv[0]) != T_STRING || !OBJ_FROZEN(argv[0]))
+		return rb_call_super(argc, argv);
+
+	cache = RTYPEDDATA_DATA(cache_obj);
+	str = argv[0];
+	entry = cache_lookup(cache, str);
+
+	if (entry != NULL && entry->linked) {
+		++cache->hits;
+		cache_unlink(cache, entry);
+		cache_push_front(cache, entry);
+		return rb_str_dup(entry->digest);
+	}
+
+	++cache->misses;
+	digest = rb_call_super(argc, argv);
+	cache_insert(cache, str, digest);
+	RB_GC_GUARD(cache_obj);
+	return digest;
+}
+
+/*
+ * call-seq: enable_digest_cache(max_bytes) -> self
+ *
+ * Enables the digest cache of the implementation class, or changes its
+ * capacity if it's already enabled.
+ *
+ * The cache memoizes the results of ::digest and ::hexdigest for frozen
+ * strings.  Entries are found by the identity of the string objects through
+ * an ObjectSpace::WeakMap, so a lookup doesn't read the string, and an equal
+ * string that is a different object gets its own entry.  Entries whose
+ * strings were garbage-collected are dropped on the next insertion.  The
+ * least recently used entries are evicted once the entries take more than
+ * +max_bytes+ bytes.  The size of an entry is its digest length plus a fixed
+ * overhead.
+ *
+ * The cache is only consulted while holding the GVL, so it's safe to use
+ * from multiple threads.  The extension isn't marked as Ractor-safe, so the
+ * cache is never used outside the main Ractor.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_enable_digest_cache(VALUE self,
+		VALUE max_bytes)
+{
+	kangarootwelve_cache_t *cache;
+	VALUE cache_obj, weak_map;
+
+	if (self == _Digest_KangarooTwelve_Impl)
+		rb_raise(rb_eRuntimeError, "Digest::KangarooTwelve::Impl is an abstract class.");
+
+	cache_obj = get_cache(self);
+
+	if (NIL_P(cache_obj)) {
+		weak_map = rb_path2class("ObjectSpace::WeakMap");
+		cache_obj = TypedData_Make_Struct(_Digest_KangarooTwelve_DigestCache,
+				kangarootwelve_cache_t, &cache_type, cache);
+		cache->map = rb_class_new_instance(0, NULL, weak_map);
+		cache->keys = rb_class_new_instance(0, NULL, weak_map);
+		cache->gc_count = rb_gc_count();
+		rb_ivar_set(self, _id_digest_cache, cache_obj);
+	} else {
+		cache = RTYPEDDATA_DATA(cache_obj);
+	}
+
+	cache->max_bytes = NUM2SIZET(max_bytes);
+	cache_shrink(cache, cache->max_bytes);
+	return self;
+}
+
+/*
+ * call-seq: disable_digest_cache -> self
+ *
+ * Disables the digest cache of the implementation class and discards its
+ * entries and counters.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_disable_digest_cache(VALUE self)
+{
+	if (self == _Digest_KangarooTwelve_Impl)
+		rb_raise(rb_eRuntimeError, "Digest::KangarooTwelve::Impl is an abstract class.");
+
+	rb_ivar_set(self, _id_digest_cache, Qnil);
+	return self;
+}
+
+/*
+ * call-seq: clear_digest_cache -> self
+ *
+ * Discards the entries of the digest cache of the implementation class and
+ * resets its counters.  The cache stays enabled.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_clear_digest_cache(VALUE self)
+{
+	kangarootwelve_cache_t *cache;
+	VALUE cache_obj;
+
+	if (self == _Digest_KangarooTwelve_Impl)
+		rb_raise(rb_eRuntimeError, "Digest::KangarooTwelve::Impl is an abstract class.");
+
+	cache_obj = get_cache(self);
+
+	if (!NIL_P(cache_obj)) {
+		cache = RTYPEDDATA_DATA(cache_obj);
+		cache_shrink(cache, 0);
+		cache->hits = cache->misses = 0;
+	}
+
+	return self;
+}
+
+/*
+ * call-seq: digest_cache_stats -> hash or nil
+ *
+ * Returns a hash with the +:hits+, +:misses+, +:entries+, +:bytes+ and
+ * +:max_bytes+ of the digest cache of the implementation class, or +nil+ if
+ * the cache isn't enabled.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_digest_cache_stats(VALUE self)
+{
+	kangarootwelve_cache_t *cache;
+	VALUE cache_obj, stats;
+
+	if (self == _Digest_KangarooTwelve_Impl)
+		rb_raise(rb_eRuntimeError, "Digest::KangarooTwelve::Impl is an abstract class.");
+
+	cache_obj = get_cache(self);
+
+	if (NIL_P(cache_obj))
+		return Qnil;
+
+	cache = RTYPEDDATA_DATA(cache_obj);
+	cache_sweep(cache);
+
+	stats = rb_hash_new();
+	rb_hash_aset(stats, ID2SYM(_id_hits), SIZET2NUM(cache->hits));
+	rb_hash_aset(stats, ID2SYM(_id_misses), SIZET2NUM(cache->misses));
+	rb_hash_aset(stats, ID2SYM(_id_entries), SIZET2NUM(cache->entries));
+	rb_hash_aset(stats, ID2SYM(_id_bytes), SIZET2NUM(cache->bytes));
+	rb_hash_aset(stats, ID2SYM(_id_max_bytes), SIZET2NUM(cache->max_bytes));
+	return stats;
+}
+
+/*
+ * Outboard chaining values
+ */
+
+#define KT_OUTBOARD_HEADER_LENGTH 8
+
+typedef struct {
+	uint64_t message_length;
+	const unsigned char *suffix;
+	size_t suffix_length;
+	uint64_t chunk_count;
+} kangarootwelve_tree_t;
+
+static size_t length_encode(uint64_t value, unsigned char *dest)
+{
+	size_t n = 0, i;
+	uint64_t v;
+
+	for (v = value; v > 0; v >>= 8)
+		++n;
+
+	for (i = 0; i < n; ++i)
+		dest[i] = (unsigned char)(value >> (8 * (n - 1 - i)));
+
+	dest[n] = (unsigned char)n;
+	return n + 1;
+}
+
+/*
+ * Returns the customization string followed by its encoded length, which is
+ * what KangarooTwelve appends to the message before splitting it into chunks.
+ */
+static VALUE build_message_suffix(VALUE customization)
+{
+	unsigned char encoded_length[9];
+	long length = NIL_P(customization) ? 0 : RSTRING_LEN(customization);
+	VALUE suffix = rb_str_buf_new(length + sizeof(encoded_length));
+
+	if (length > 0)
+		rb_str_cat(suffix, RSTRING_PTR(customization), length);
+
+	rb_str_cat(suffix, (const char *)encoded_length, length_encode(length, encoded_length));
+	return suffix;
+}
+
+static void init_tree(kangarootwelve_tree_t *tree, uint64_t message_length, VALUE suffix)
+{
+	tree->message_length = message_length;
+	tree->suffix = _RSTRING_PTR_U(suffix);
+	tree->suffix_length = RSTRING_LEN(suffix);
+	tree->chunk_count = (message_length + tree->suffix_length + KT_BLOCK_LENGTH - 1) /
+			KT_BLOCK_LENGTH;
+}
+
+static size_t get_chunk_message_length(kangarootwelve_tree_t *tree, uint64_t index)
+{
+	uint64_t start = index * KT_BLOCK_LENGTH;
+
+	if (start >= tree->message_length)
+		return 0;
+
+	return tree->message_length - start < KT_BLOCK_LENGTH ?
+			(size_t)(tree->message_length - start) : KT_BLOCK_LENGTH;
+}
+
+/*
+ * Returns the part of the message suffix that falls into a chunk.
+ */
+static size_t get_chunk_suffix(kangarootwelve_tree_t *tree, uint64_t index,
+		const unsigned char **suffix)
+{
+	uint64_t start = index * KT_BLOCK_LENGTH, end = start + KT_BLOCK_LENGTH, from;
+
+	if (end <= tree->message_length)
+		return 0;
+
+	from = start > tree->message_length ? start - tree->message_length : 0;
+	end -= tree->message_length;
+
+	if (end > tree->suffix_length)
+		end = tree->suffix_length;
+
+	*suffix = tree->suffix + from;
+	return from < end ? (size_t)(end - from) : 0;
+}
+
+static int compute_chunk_chaining_value(kangarootwelve_tree_t *tree, uint64_t index,
+		const unsigned char *data, unsigned char *chaining_value)
+{
+	const unsigned char *suffix = NULL;
+	size_t suffix_length = get_chunk_suffix(tree, index, &suffix);
+
+	return compute_chaining_value(data, get_chunk_message_length(tree, index), suffix,
+			suffix_length, chaining_value);
+}
+
+/*
+ * Computes the digest from the message part of the first chunk and the
+ * chaining values of the other chunks.
+ */
+static int compute_root(kangarootwelve_tree_t *tree, const unsigned char *first_chunk,
+		const unsigned char *chaining_values, unsigned char *output, size_t output_length)
+{
+	static const unsigned char first_chunk_padding[8] = { 0x03 };
+	static const unsigned char terminator[2] = { 0xFF, 0xFF };
+	KeccakWidth1600_12rounds_SpongeInstance final;
+	const unsigned char *suffix = NULL;
+	unsigned char encoded_count[9];
+	size_t suffix_length = get_chunk_suffix(tree, 0, &suffix);
+
+	if (KeccakWidth1600_12rounds_SpongeInitialize(&final, 1344, 256) != 0 ||
+			KeccakWidth1600_12rounds_SpongeAbsorb(&final, first_chunk,
+					get_chunk_message_length(tree, 0)) != 0 ||
+			KeccakWidth1600_12rounds_SpongeAbsorb(&final, suffix, suffix_length) != 0)
+		return 1;
+
+	if (tree->chunk_count == 1) {
+		if (KeccakWidth1600_12rounds_SpongeAbsorbLastFewBits(&final, 0x07) != 0)
+			return 1;
+	} else {
+		if (KeccakWidth1600_12rounds_SpongeAbsorb(&final, first_chunk_padding,
+						sizeof(first_chunk_padding)) != 0 ||
+				KeccakWidth1600_12rounds_SpongeAbsorb(&final, chaining_values,
+						(tree->chunk_count - 1) * KT_CHAINING_VALUE_LENGTH) != 0 ||
+				KeccakWidth1600_12rounds_SpongeAbsorb(&final, encoded_count,
+						length_encode(tree->chunk_count - 1, encoded_count)) != 0 ||
+				KeccakWidth1600_12rounds_SpongeAbsorb(&final, terminator,
+						sizeof(terminator)) != 0 ||
+				KeccakWidth1600_12rounds_SpongeAbsorbLastFewBits(&final, 0x06) != 0)
+			return 1;
+	}
+
+	return KeccakWidth1600_12rounds_SpongeSqueeze(&final, output, output_length);
+}
+
+/*
+ * call-seq: outboard(string) -> string
+ *
+ * Returns an outboard sidecar for +string+ which can be checked once against
+ * the digest of +string+ with ::verify_outboard, and then be used with
+ * ::verify_range to verify chunk-aligned ranges of +string+ without having
+ * the rest of it.
+ *
+ * The sidecar consists of the message length as an 8-byte big-endian
+ * integer, the first chunk of the message (up to 8192 bytes), and the 32-byte
+ * chaining values of the rest of the chunks.  The chunks are those of the
+ * message with the customization string of the implementation class appended
+ * to it, so a sidecar is only valid for the class that made it.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_outboard(VALUE self, VALUE str)
+{
+	kangarootwelve_tree_t tree;
+	VALUE customization, suffix, outboard;
+	unsigned char *dest;
+	int digest_length;
+	size_t first_chunk_length;
+	uint64_t i, length;
+
+	get_impl_class_params(self, &digest_length, &customization);
+	StringValue(str);
+	suffix = build_message_suffix(customization);
+	init_tree(&tree, RSTRING_LEN(str), suffix);
+	first_chunk_length = get_chunk_message_length(&tree, 0);
+	outboard = rb_str_new(0, KT_OUTBOARD_HEADER_LENGTH + first_chunk_length +
+			(tree.chunk_count - 1) * KT_CHAINING_VALUE_LENGTH);
+	dest = _RSTRING_PTR_U(outboard);
+
+	for (i = KT_OUTBOARD_HEADER_LENGTH, length = tree.message_length; i > 0; --i) {
+		dest[i - 1] = (unsigned char)(length & 0xff);
+		length >>= 8;
+	}
+
+	dest += KT_OUTBOARD_HEADER_LENGTH;
+	memcpy(dest, RSTRING_PTR(str), first_chunk_length);
+	dest += first_chunk_length;
+
+	for (i = 1; i < tree.chunk_count; ++i, dest += KT_CHAINING_VALUE_LENGTH) {
+		if (compute_chunk_chaining_value(&tree, i, _RSTRING_PTR_U(str) + i * KT_BLOCK_LENGTH,
+				dest) != 0)
+			rb_raise(rb_eRuntimeError, "Failed to compute chaining value.");
+	}
+
+	RB_GC_GUARD(suffix);
+	return outboard;
+}
+
+/*
+ * Sets up +tree+ for the message length in the header of +outboard+.  Returns
+ * zero if the length of the sidecar doesn't match it.
+ */
+static int parse_outboard(kangarootwelve_tree_t *tree, VALUE outboard, VALUE suffix)
+{
+	const unsigned char *src = _RSTRING_PTR_U(outboard);
+	uint64_t message_length;
+	int i;
+
+	if (RSTRING_LEN(outboard) < KT_OUTBOARD_HEADER_LENGTH)
+		return 0;
+
+	for (i = 0, message_length = 0; i < KT_OUTBOARD_HEADER_LENGTH; ++i)
+		message_length = message_length << 8 | src[i];
+
+	if (message_length / KT_BLOCK_LENGTH > (uint64_t)RSTRING_LEN(outboard))
+		return 0;
+
+	init_tree(tree, message_length, suffix);
+	return (uint64_t)RSTRING_LEN(outboard) == KT_OUTBOARD_HEADER_LENGTH +
+			get_chunk_message_length(tree, 0) +
+			(tree->chunk_count - 1) * KT_CHAINING_VALUE_LENGTH;
+}
+
+/*
+ * call-seq: verify_outboard(digest, outboard) -> true or false
+ *
+ * Verifies an +outboard+ sidecar made by ::outboard against the +digest+ of
+ * its message.  This absorbs all the chaining values in the sidecar (about
+ * 1/256 of the message size), so it's meant to be done once per sidecar,
+ * before its ranges are checked with ::verify_range.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_verify_outboard(VALUE self, VALUE digest,
+		VALUE outboard)
+{
+	kangarootwelve_tree_t tree;
+	VALUE customization, suffix, root_tmp;
+	const unsigned char *first_chunk;
+	unsigned char *root;
+	int digest_length, valid;
+
+	get_impl_class_params(self, &digest_length, &customization);
+	StringValue(digest);
+	StringValue(outboard);
+	suffix = build_message_suffix(customization);
+
+	if (RSTRING_LEN(digest) != digest_length || !parse_outboard(&tree, outboard, suffix))
+		return Qfalse;
+
+	first_chunk = _RSTRING_PTR_U(outboard) + KT_OUTBOARD_HEADER_LENGTH;
+	root = ALLOCV_N(unsigned char, root_tmp, digest_length);
+
+	if (compute_root(&tree, first_chunk, first_chunk + get_chunk_message_length(&tree, 0), root,
+			digest_length) != 0)
+		rb_raise(rb_eRuntimeError, "Failed to compute digest.");
+
+	valid = memcmp(root, RSTRING_PTR(digest), digest_length) == 0;
+	ALLOCV_END(root_tmp);
+	RB_GC_GUARD(suffix);
+	return valid ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq: verify_range(outboard, offset, data) -> true or false
+ *
+ * Verifies that +data+ is the part of a message starting at +offset+, given
+ * the message's +outboard+ sidecar made by ::outboard.  Only the chunks of
+ * +data+ are hashed, so the cost is proportional to the size of +data+.
+ *
+ * The sidecar itself isn't checked against a digest here.  It has to be
+ * trusted, or checked once with ::verify_outboard first.
+ *
+ * +offset+ has to be a multiple of 8192, and +data+ has to end either at a
+ * multiple of 8192 or at the end of the message.  Otherwise an ArgumentError
+ * is raised.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_singleton_verify_range(VALUE self, VALUE outboard,
+		VALUE offset, VALUE data)
+{
+	kangarootwelve_tree_t tree;
+	VALUE customization, suffix;
+	const unsigned char *first_chunk, *chaining_values, *chunk;
+	unsigned char chaining_value[KT_CHAINING_VALUE_LENGTH];
+	uint64_t offset_int, end, index;
+	size_t first_chunk_length;
+	int digest_length, valid = 1;
+
+	get_impl_class_params(self, &digest_length, &customization);
+	StringValue(outboard);
+	StringValue(data);
+	offset_int = NUM2ULL(offset);
+
+	if (offset_int % KT_BLOCK_LENGTH != 0)
+		rb_raise(rb_eArgError, "Offset is not a multiple of the chunk length.");
+
+	suffix = build_message_suffix(customization);
+
+	if (!parse_outboard(&tree, outboard, suffix))
+		return Qfalse;
+
+	if (offset_int > tree.message_length ||
+			(uint64_t)RSTRING_LEN(data) > tree.message_length - offset_int)
+		return Qfalse;
+
+	end = offset_int + RSTRING_LEN(data);
+
+	if (end != tree.message_length && end % KT_BLOCK_LENGTH != 0)
+		rb_raise(rb_eArgError, "Data does not end at a multiple of the chunk length or at the "
+				"end of the message.");
+
+	first_chunk = _RSTRING_PTR_U(outboard) + KT_OUTBOARD_HEADER_LENGTH;
+	first_chunk_length = get_chunk_message_length(&tree, 0);
+	chaining_values = first_chunk + first_chunk_length;
+
+	for (index = offset_int / KT_BLOCK_LENGTH; valid && index * KT_BLOCK_LENGTH < end; ++index) {
+		chunk = _RSTRING_PTR_U(data) + (index * KT_BLOCK_LENGTH - offset_int);
+
+		if (index == 0) {
+			valid = memcmp(chunk, first_chunk, first_chunk_length) == 0;
+		} else {
+			if (compute_chunk_chaining_value(&tree, index, chunk, chaining_value) != 0)
+				rb_raise(rb_eRuntimeError, "Failed to compute chaining value.");
+
+			valid = memcmp(chaining_value, chaining_values + (index - 1) *
+					KT_CHAINING_VALUE_LENGTH, KT_CHAINING_VALUE_LENGTH) == 0;
+		}
+	}
+
+	RB_GC_GUARD(suffix);
+	return valid ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq: customization -> string or nil
+ *
+ * Returns configured customization string of the implementation object.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_customization(VALUE self)
+{
+	VALUE customization;
+
+	if (rb_ivar_defined(self, _id_customization)) {
+		customization = rb_ivar_get(self, _id_customization);
+	} else {
+		VALUE klass = rb_obj_class(self);
+		customization = rb_ivar_get(klass, _id_customization);
+		rb_ivar_set(self, _id_customization, customization);
+	}
+
+	return customization;
+}
+
+/*
+ * call-seq: customization_hex -> string or nil
+ *
+ * Returns configured customization string of the implementation object in hex.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_customization_hex(VALUE self)
+{
+	VALUE customization = rb_funcall(self, _id_customization, 0);
+	return hex_encode_str(customization);
+}
+
+/*
+ * call-seq: finish_multi([{ customization: string or nil, length: int }, ...]) -> array
+ *
+ * Returns the digests of the data absorbed so far for each of the output
+ * specifications, without resetting the object.  The data is only absorbed
+ * once, so this is cheaper than hashing it with a class for each output.
+ *
+ * See Digest::KangarooTwelve::Impl.digest_multi for the format of the
+ * specifications.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_finish_multi(VALUE self, VALUE specs)
+{
+	VALUE customization;
+	int digest_length;
+
+	get_impl_class_params(rb_obj_class(self), &digest_length, &customization);
+	return finish_multi(&KT_CONTEXT_PTR(DATA_PTR(self))->instance, specs, digest_length,
+			customization);
+}
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+
+#define KT_FILE_OK 0
+#define KT_FILE_SYSTEM_ERROR 1
+#define KT_FILE_HASH_FAILED 2
+#define KT_FILE_INTERRUPTED 3
+
+typedef struct {
+	KangarooTwelve_Instance *instance;
+	int fd;
+	int regular;
+	off_t size;
+	off_t offset;
+	int eof;
+	unsigned char *buffer;
+	int status;
+	int error;
+	volatile int *interrupted;
+} kangarootwelve_file_args_t;
+
+static int fail_file(kangarootwelve_file_args_t *args, int status)
+{
+	args->status = status;
+
+	if (status == KT_FILE_SYSTEM_ERROR)
+		args->error = errno;
+
+	return 0;
+}
+
+static int read_fully(kangarootwelve_file_args_t *args, unsigned char *buffer, size_t length,
+		off_t offset, size_t *read_length)
+{
+	ssize_t n;
+
+	for (*read_length = 0; *read_length < length; *read_length += n) {
+		if (*args->interrupted)
+			return fail_file(args, KT_FILE_INTERRUPTED);
+
+		n = pread(args->fd, buffer + *read_length, length - *read_length,
+				offset + *read_length);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return fail_file(args, KT_FILE_SYSTEM_ERROR);
+		}
+
+		if (n == 0)
+			break;
+	}
+
+	return 1;
+}
+
+/*
+ * Returns zero if hashing should stop, either because of an error or because
+ * the end of the file was reached earlier than expected.  args->offset is
+ * advanced past every block that gets absorbed, so hashing can resume from it
+ * after an interruption.
+ */
+static int hash_file_data(kangarootwelve_file_args_t *args, off_t offset, off_t length)
+{
+	size_t len, read_length;
+
+	while (length > 0) {
+		len = length < KT_FILE_BUFFER_LENGTH ? (size_t)length : KT_FILE_BUFFER_LENGTH;
+
+		if (!read_fully(args, args->buffer, len, offset, &read_length))
+			return 0;
+
+		if (update_skipping_zero_chunks(args->instance, args->buffer, read_length) != 0)
+			return fail_file(args, KT_FILE_HASH_FAILED);
+
+		args->offset = offset + read_length;
+
+		if (read_length < len)
+			return 0;
+
+		offset += len;
+		length -= len;
+	}
+
+	return 1;
+}
+
+static void *hash_file_regions(void *ptr)
+{
+	kangarootwelve_file_args_t *args = ptr;
+	off_t pos, data, hole;
+
+	for (pos = args->offset; pos < args->size; pos = hole) {
+		data = lseek(args->fd, pos, SEEK_DATA);
+
+		if (data < 0) {
+			if (errno != ENXIO) {
+				/* Holes cannot be detected, so read the rest of the file. */
+				data = pos;
+				hole = args->size;
+			} else {
+				data = hole = args->size;
+			}
+		} else {
+			hole = lseek(args->fd, data, SEEK_HOLE);
+
+			if (hole < 0 || hole > args->size)
+				hole = args->size;
+		}
+
+		if (update_with_zeros(args->instance, data - pos) != 0) {
+			fail_file(args, KT_FILE_HASH_FAILED);
+			return NULL;
+		}
+
+		args->offset = data;
+
+		if (data == hole)
+			continue;
+
+		if (!hash_file_data(args, data, hole - data)) {
+			args->eof = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads and absorbs the next block of a file sequentially, for files whose
+ * size isn't known in advance.
+ */
+static void *hash_file_stream_block(void *ptr)
+{
+	kangarootwelve_file_args_t *args = ptr;
+	ssize_t n = read(args->fd, args->buffer, KT_FILE_BUFFER_LENGTH);
+
+	if (n < 0) {
+		if (errno != EINTR)
+			fail_file(args, KT_FILE_SYSTEM_ERROR);
+	} else if (n == 0) {
+		args->eof = 1;
+	} else if (update_skipping_zero_chunks(args->instance, args->buffer, n) != 0) {
+		fail_file(args, KT_FILE_HASH_FAILED);
+	}
+
+	return NULL;
+}
+
+static void interrupt_file_hashing(void *ptr)
+{
+	*((kangarootwelve_file_args_t *)ptr)->interrupted = 1;
+}
+
+static VALUE hash_file(VALUE ptr)
+{
+	kangarootwelve_file_args_t *args = (kangarootwelve_file_args_t *)ptr;
+
+	/*
+	 * Regular files can still grow, and files in /proc report a size of 0, so
+	 * reading continues after the reported size until end-of-file.
+	 */
+	if (args->regular) {
+		for (;;) {
+			rb_thread_call_without_gvl(hash_file_regions, args, interrupt_file_hashing, args);
+
+			if (args->status != KT_FILE_INTERRUPTED)
+				break;
+
+			/*
+			 * Interrupts like trapped signals and Thread#wakeup don't have
+			 * to stop hashing, so handle them with the GVL and resume from
+			 * the last absorbed block unless they raise.
+			 */
+			args->status = KT_FILE_OK;
+			*args->interrupted = 0;
+			rb_thread_check_ints();
+		}
+
+		if (args->status == KT_FILE_OK && !args->eof &&
+				lseek(args->fd, args->size, SEEK_SET) < 0)
+			fail_file(args, KT_FILE_SYSTEM_ERROR);
+	}
+
+	while (args->status == KT_FILE_OK && !args->eof) {
+		rb_thread_call_without_gvl(hash_file_stream_block, args, RUBY_UBF_IO, NULL);
+		rb_thread_check_ints();
+	}
+
+	return Qnil;
+}
+
+/*
+ * Opening a FIFO blocks until it has a writer, so it's done without the GVL
+ * like File.open does it.
+ */
+static void *open_file(void *path)
+{
+	return (void *)(VALUE)rb_cloexec_open(RSTRING_PTR((VALUE)path), O_RDONLY, 0);
+}
+
+static VALUE close_file(VALUE ptr)
+{
+	close(((kangarootwelve_file_args_t *)ptr)->fd);
+	return Qnil;
+}
+
+/*
+ * call-seq: file(name) -> self
+ *
+ * Updates the object with the contents of the file named +name+.
+ *
+ * Holes in sparse regular files are found with +SEEK_DATA+ and +SEEK_HOLE+ and
+ * are hashed as zero bytes without being read.  Chunks of zero bytes that align
+ * with the 8192-byte chunks of KangarooTwelve reuse a precomputed chaining
+ * value, so the time spent on holes is a small fraction of the time spent on
+ * data.  The digest is the same as when the file is read normally.
+ *
+ * The file is hashed without holding the global VM lock, so other threads
+ * can hash other files at the same time.  The data is absorbed into a copy of
+ * the object's state, which replaces the state only after the whole file has
+ * been hashed, so the object is left unchanged if an exception is raised.
+ *
+ * Files that aren't regular files, like FIFOs and character devices, are read
+ * sequentially.  Reading always continues until end-of-file, even past the
+ * size reported for the file, like for files in /proc.
+ */
+static VALUE _Digest_KangarooTwelve_Impl_file(VALUE self, VALUE name)
+{
+	kangarootwelve_file_args_t args;
+	KangarooTwelve_Instance instance;
+	VALUE path, buffer_tmp;
+	volatile int interrupted = 0;
+	struct stat st;
+	int error;
+
+	rb_check_frozen(self);
+	FilePathValue(name);
+	path = rb_str_encode_ospath(name);
+	instance = KT_CONTEXT_PTR(DATA_PTR(self))->instance;
+	args.instance = &instance;
+	args.status = KT_FILE_OK;
+	args.interrupted = &interrupted;
+	StringValueCStr(path);
+
+	while ((args.fd = (int)(VALUE)rb_thread_call_without_gvl(open_file, (void *)path,
+			RUBY_UBF_IO, NULL)) < 0) {
+		if (errno != EINTR)
+			rb_sys_fail_str(path);
+
+		rb_thread_check_ints();
+	}
+
+	rb_update_max_fd(args.fd);
+
+	if (fstat(args.fd, &st) != 0) {
+		error = errno;
+		close(args.fd);
+		errno = error;
+		rb_sys_fail_str(path);
+	}
+
+	args.regular = S_ISREG(st.st_mode);
+	args.size = st.st_size;
+	args.offset = 0;
+	args.eof = 0;
+	args.buffer = ALLOCV_N(unsigned char, buffer_tmp, KT_FILE_BUFFER_LENGTH);
+	rb_ensure(hash_file, (VALUE)&args, close_file, (VALUE)&args);
+	ALLOCV_END(buffer_tmp);
+
+	switch (args.status) {
+	case KT_FILE_SYSTEM_ERROR:
+		errno = args.error;
+		rb_sys_fail_str(path);
+	case KT_FILE_HASH_FAILED:
+		rb_raise(rb_eRuntimeError, "Hash update failed.");
+	}
+
+	KT_CONTEXT_PTR(DATA_PTR(self))->instance = instance;
+	return self;
+}
+
+#endif
+
+/*
+ * call-seq: inspect -> string
+ *
+ * Returns a string in the form of #<impl_class_name|digest_length|hex_cust_string|hex_digest>
+ */
+static VALUE _Digest_KangarooTwelve_Impl_inspect(VALUE self)
+{
+	VALUE klass, klass_name, digest_length, customization_hex, hexdigest, args[4];
+
+	klass = rb_obj_class(self);
+	klass_name = rb_class_name(klass);
+
+	if (klass_name == Qnil)
+		klass_name = rb_inspect(klass);
+
+	digest_length = rb_funcall(self, _id_digest_length, 0);
+	customization_hex = rb_funcall(self, _id_customization_hex, 0);
+	hexdigest = rb_funcall(self, _id_hexdigest, 0);
+
+	args[0] = klass_name;
+	args[1] = digest_length;
+	args[2] = customization_hex;
+	args[3] = hexdigest;
+	return rb_str_format(sizeof(args), args, rb_str_new_literal("#<%s:%d|%s|%s>"));
+}
+
+/*
+ * Init
+ */
+
+void Init_kangarootwelve(void)
+{
+	#define DEFINE_ID(x) _id_##x = rb_intern_const(#x);
+
+	DEFINE_ID(auto)
+	DEFINE_ID(block_length)
+	DEFINE_ID(b)
+	DEFINE_ID(bytes)
+	DEFINE_ID(ch)
+	DEFINE_ID(customization)
+	DEFINE_ID(customization_hex)
+	DEFINE_ID(c)
+	DEFINE_ID(default)
+	DEFINE_ID(digest_cache)
+	DEFINE_ID(digest_length)
+	DEFINE_ID(d)
+	DEFINE_ID(entries)
+	DEFINE_ID(hexdigest)
+	DEFINE_ID(hits)
+	DEFINE_ID(length)
+	DEFINE_ID(max_bytes)
+	DEFINE_ID(metadata)
+	DEFINE_ID(misses)
+	DEFINE_ID(name)
+	DEFINE_ID(new)
+	DEFINE_ID(n)
+	DEFINE_ID(unpack)
+
+	_id_aref = rb_intern_const("[]");
+	_id_aset = rb_intern_const("[]=");
+
+	init_chaining_value_absorption();
+
+	rb_require("digest");
+	_Digest = rb_path2class("Digest");
+
+	#if 0
+	/* Tell RDoc about Digest since it doesn't recognize rb_path2class. */
+	_Digest = rb_define_module("Digest");
+	#endif
+
+	/*
+	 * Document-module: Digest::KangarooTwelve
+	 */
+
+	_Digest_KangarooTwelve = rb_define_module_under(_Digest, "KangarooTwelve");
+
+	rb_define_singleton_method(_Digest_KangarooTwelve, "default",
+			_Digest_KangarooTwelve_singleton_default, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve, "implement",
+			_Digest_KangarooTwelve_singleton_implement, -1);
+	rb_define_singleton_method(_Digest_KangarooTwelve, "[]",
+			_Digest_KangarooTwelve_singleton_implement_simple, 1);
+
+	/*
+	 * Document-const: Digest::KangarooTwelve::BLOCK_LENGTH
+	 *
+	 * 8192 bytes
+	 */
+
+	/* 8192 bytes */
+
+	rb_define_const(_Digest_KangarooTwelve, "BLOCK_LENGTH", INT2FIX(KT_BLOCK_LENGTH));
+
+	/*
+	 * Document-const: Digest::KangarooTwelve::DEFAULT_DIGEST_LENGTH
+	 *
+	 * 64 bytes (512 bits)
+	 */
+
+	/* 64 bytes (512 bits) */
+
+	rb_define_const(_Digest_KangarooTwelve, "DEFAULT_DIGEST_LENGTH",
+			INT2FIX(KT_DEFAULT_DIGEST_LENGTH));
+
+	/*
+	 * Document-class: Digest::KangarooTwelve::Impl
+	 */
+
+	_Digest_KangarooTwelve_Impl = rb_define_class_under(_Digest_KangarooTwelve, "Impl",
+			rb_path2class("Digest::Base"));
+
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "new",
+			_Digest_KangarooTwelve_Impl_singleton_new, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "block_length",
+			_Digest_KangarooTwelve_Impl_singleton_block_length, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest_length",
+			_Digest_KangarooTwelve_Impl_singleton_digest_length, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "customization",
+			_Digest_KangarooTwelve_Impl_singleton_customization, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "customization_hex",
+			_Digest_KangarooTwelve_Impl_singleton_customization_hex, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest",
+			_Digest_KangarooTwelve_Impl_singleton_digest, -1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "enable_digest_cache",
+			_Digest_KangarooTwelve_Impl_singleton_enable_digest_cache, 1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "disable_digest_cache",
+			_Digest_KangarooTwelve_Impl_singleton_disable_digest_cache, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "clear_digest_cache",
+			_Digest_KangarooTwelve_Impl_singleton_clear_digest_cache, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest_cache_stats",
+			_Digest_KangarooTwelve_Impl_singleton_digest_cache_stats, 0);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest_object",
+			_Digest_KangarooTwelve_Impl_singleton_digest_object, 1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "hash64",
+			_Digest_KangarooTwelve_Impl_singleton_hash64, 1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "hash64_many",
+			_Digest_KangarooTwelve_Impl_singleton_hash64_many, 1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "hash64_k",
+			_Digest_KangarooTwelve_Impl_singleton_hash64_k, 2);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "digest_multi",
+			_Digest_KangarooTwelve_Impl_singleton_digest_multi, 2);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "outboard",
+			_Digest_KangarooTwelve_Impl_singleton_outboard, 1);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "verify_outboard",
+			_Digest_KangarooTwelve_Impl_singleton_verify_outboard, 2);
+	rb_define_singleton_method(_Digest_KangarooTwelve_Impl, "verify_range",
+			_Digest_KangarooTwelve_Impl_singleton_verify_range, 3);
+
+	rb_define_method(_Digest_KangarooTwelve_Impl, "customization",
+			_Digest_KangarooTwelve_Impl_customization, 0);
+	rb_define_method(_Digest_KangarooTwelve_Impl, "customization_hex",
+			_Digest_KangarooTwelve_Impl_customization_hex, 0);
+	rb_define_method(_Digest_KangarooTwelve_Impl, "finish_multi",
+			_Digest_KangarooTwelve_Impl_finish_multi, 1);
+	rb_define_method(_Digest_KangarooTwelve_Impl, "inspect",
+			_Digest_KangarooTwelve_Impl_inspect, 0);
+
+	#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	rb_define_method(_Digest_KangarooTwelve_Impl, "file", _Digest_KangarooTwelve_Impl_file, 1);
+	#endif
+
+	/*
+	 * Document-class: Digest::KangarooTwelve::Metadata
+	 *
+	 * This class represents the internal metadata produced for the
+	 * implementation classes.
+	 */
+
+	_Digest_KangarooTwelve_Metadata = rb_define_class_under(_Digest_KangarooTwelve, "Metadata",
+			rb_cObject);
+
+	rb_undef_alloc_func(_Digest_KangarooTwelve_Metadata);
+
+	/*
+	 * Document-class: Digest::KangarooTwelve::DigestCache
+	 *
+	 * This class represents the internal digest cache of an implementation
+	 * class.
+	 */
+
+	_Digest_KangarooTwelve_DigestCache = rb_define_class_under(_Digest_KangarooTwelve,
+			"DigestCache", rb_cObject);
+
+	rb_undef_alloc_func(_Digest_KangarooTwelve_DigestCache);
 
 	rb_require("digest/kangarootwelve/version");
 }
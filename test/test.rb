@@ -1,4 +1,7 @@
 require 'minitest/autorun'
+require 'rbconfig'
+require 'tempfile'
+require 'tmpdir'
 require File.expand_path('../../lib/digest/kangarootwelve', __FILE__)
 
 def get_repeated_0x00_to_0xfa(length)
@@ -18,6 +21,23 @@ def hex_encode(str)
   str.unpack('H*').pop
 end
 
+def encode_object(obj)
+  case obj
+  when nil then "N"
+  when false then "F"
+  when true then "T"
+  when Integer
+    magnitude = obj.abs.zero? ? "" : [obj.abs.to_s(16).rjust((obj.abs.bit_length + 7) / 8 * 2, "0")].pack('H*')
+    "I" + [magnitude.bytesize].pack('Q>') + (obj < 0 ? "\x01" : "\x00") + magnitude
+  when Float then "D" + [obj].pack('G')
+  when String then "S" + [obj.bytesize].pack('Q>') + obj.b
+  when Symbol then "Y" + [obj.to_s.bytesize].pack('Q>') + obj.to_s.b
+  when Array then "A" + [obj.size].pack('Q>') + obj.map{ |e| encode_object(e) }.join
+  when Hash
+    "H" + [obj.size].pack('Q>') + obj.map{ |k, v| [encode_object(k), encode_object(v)] }.sort.join
+  end.b
+end
+
 describe Digest::KangarooTwelve do
   it "produces implementation classes" do
     _(Digest::KangarooTwelve[32].superclass).must_equal Digest::KangarooTwelve::Impl
@@ -135,6 +155,258 @@ describe Digest::KangarooTwelve do
     end
   end
 
+  it "produces equal hashes for zero-filled chunks regardless of how they are fed" do
+    m = ("\0" * 8192 * 3) + get_repeated_0xff(100) + ("\0" * 8192 * 4) + get_repeated_0x00_to_0xfa(9000) + ("\0" * 20000)
+    d = Digest::KangarooTwelve[32].new
+    m.each_char.each_slice(777){ |e| d.update(e.join) }
+    _(Digest::KangarooTwelve[32].digest(m)).must_equal d.digest
+    _(Digest::KangarooTwelve[32].hexdigest("\0" * 8192 * 2)).must_equal Digest::KangarooTwelve[32].new.update("\0" * 8192).update("\0" * 8192).hexdigest
+  end
+
+  it "produces hashes of sparse files that match their contents" do
+    Tempfile.create("kangarootwelve") do |f|
+      f.truncate(8192 * 40 + 5)
+      f.seek(8192 * 3 + 11)
+      f.write(get_repeated_0x00_to_0xfa(20000))
+      f.seek(8192 * 30)
+      f.write(get_repeated_0xff(10))
+      f.close
+      _(Digest::KangarooTwelve[32].file(f.path).hexdigest).must_equal Digest::KangarooTwelve[32].hexdigest(File.binread(f.path))
+    end
+  end
+
+  it "produces hashes of files that don't report their size, like FIFOs" do
+    skip "mkfifo is not supported" unless File.respond_to?(:mkfifo)
+    Dir.mktmpdir("kangarootwelve") do |dir|
+      path = File.join(dir, "fifo")
+      File.mkfifo(path)
+      m = get_repeated_0x00_to_0xfa(20000) + ("\0" * 8192 * 2)
+      writer = Thread.new{ File.open(path, "wb"){ |f| f.write(m) } }
+      _(Digest::KangarooTwelve[32].file(path).hexdigest).must_equal Digest::KangarooTwelve[32].hexdigest(m)
+      writer.join
+    end
+
+    if File.exist?("/proc/self/cmdline")
+      _(Digest::KangarooTwelve[32].file("/proc/self/cmdline").hexdigest).must_equal Digest::KangarooTwelve[32].hexdigest(File.binread("/proc/self/cmdline"))
+    end
+  end
+
+  it "produces digests for multiple outputs from a single absorption" do
+    m = get_repeated_0x00_to_0xfa(17 ** 4)
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd")
+    expected = [
+      klass.digest(m),
+      Digest::KangarooTwelve.implement(name: nil, digest_length: 64, customization: "abcd").digest(m),
+      Digest::KangarooTwelve[48].digest(m),
+      Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "key").digest(m)
+    ]
+    specs = [{}, { length: 64 }, { customization: nil, d: 48 }, { ch: "6b6579" }]
+    _(klass.digest_multi(m, specs)).must_equal expected
+    d = klass.new.update(m[0, 1000]).update(m[1000..-1])
+    _(d.finish_multi(specs)).must_equal expected
+    _(d.digest).must_equal expected[0]
+    _{ klass.digest_multi(m, [1]) }.must_raise TypeError
+  end
+
+  it "produces 62-bit integer hashes from the first 8 bytes of digests" do
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd")
+    strs = ["", "abc", get_repeated_0x00_to_0xfa(17 ** 4)] + 100.times.map(&:to_s)
+    mask = 2 ** 62 - 1
+    _(klass.hash64("abc")).must_equal klass.digest("abc").unpack('Q<').first & mask
+    _(klass.hash64_many(strs)).must_equal strs.map{ |e| klass.digest(e).unpack('Q<').first & mask }
+    _(klass.hash64_many(strs).all?{ |e| e.between?(0, mask) }).must_equal true
+    _(Digest::KangarooTwelve[32].hash64("abc")).wont_equal klass.hash64("abc")
+    values = klass.hash64_k("abc", 4)
+    _(values).must_equal Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd").digest("abc").unpack('Q<4').map{ |e| e & mask }
+    yielded = []
+    _(klass.hash64_k("abc", 4){ |e| yielded << e }).must_be_nil
+    _(yielded).must_equal values
+
+    if 1.size == 8
+      klass.hash64("warmup")
+      allocated = GC.stat(:total_allocated_objects)
+      strs.each{ |e| klass.hash64(e) }
+      _(GC.stat(:total_allocated_objects) - allocated).must_be :<, 10
+    end
+  end
+
+  it "verifies chunk-aligned ranges using an outboard sidecar checked against a digest" do
+    m = get_repeated_0x00_to_0xfa(8192 * 5 + 100)
+    [Digest::KangarooTwelve[32], Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "x" * 9000)].each do |klass|
+      outboard = klass.outboard(m)
+      digest = klass.digest(m)
+      _(outboard.bytesize).must_equal 8 + 8192 + 32 * (klass.customization ? 6 : 5)
+      _(klass.verify_outboard(digest, outboard)).must_equal true
+      _(klass.verify_outboard(digest.succ, outboard)).must_equal false
+      _(klass.verify_outboard(digest, outboard.succ)).must_equal false
+      _(klass.verify_outboard(digest, outboard[0..-2])).must_equal false
+      _(klass.verify_range(outboard, 0, m)).must_equal true
+      _(klass.verify_range(outboard, 8192, m[8192, 8192 * 2])).must_equal true
+      _(klass.verify_range(outboard, 8192 * 5, m[8192 * 5..-1])).must_equal true
+      _(klass.verify_range(outboard, 8192, m[8192, 8192].succ)).must_equal false
+      _(klass.verify_range(outboard[0..-2], 8192, m[8192, 8192])).must_equal false
+      _{ klass.verify_range(outboard, 100, m[100, 8092]) }.must_raise ArgumentError
+    end
+
+    klass = Digest::KangarooTwelve[32]
+    _(klass.verify_range(klass.outboard(""), 2 ** 64 - 8192, "x" * 8192)).must_equal false
+    _(klass.verify_range(klass.outboard(m), 8192 * 6, "x")).must_equal false
+  end
+
+  it "resumes hashing files after interrupts that don't raise" do
+    skip "Impl#file is not natively implemented" unless Digest::KangarooTwelve::Impl.instance_method(:file).owner == Digest::KangarooTwelve::Impl
+    skip "SIGUSR1 is not supported" unless Signal.list["USR1"]
+    Tempfile.create("kangarootwelve") do |f|
+      f.write(get_repeated_0x00_to_0xfa(8192 * 2048))
+      f.close
+      expected = Digest::KangarooTwelve[32].new.update("abc").update(File.binread(f.path)).hexdigest
+      previous = trap("USR1"){}
+
+      begin
+        done = false
+        signaller = Thread.new{ until done; Process.kill("USR1", Process.pid); sleep 0.001; end }
+        _(Digest::KangarooTwelve[32].new.update("abc").file(f.path).hexdigest).must_equal expected
+        done = true
+        signaller.join
+      ensure
+        trap("USR1", previous)
+      end
+
+      d = Digest::KangarooTwelve[32].new.update("abc")
+      hasher = Thread.new{ d.file(f.path) }
+      until hasher.join(0.001)
+        begin
+          hasher.wakeup
+        rescue ThreadError
+        end
+      end
+
+      _(hasher.value.hexdigest).must_equal expected
+
+      d = Digest::KangarooTwelve[32].new.update("abc")
+
+      hasher = Thread.new do
+        Thread.current.report_on_exception = false if Thread.current.respond_to?(:report_on_exception=)
+        Thread.stop
+        d.file(f.path)
+      end
+
+      Thread.pass until hasher.status == "sleep" || !hasher.alive?
+      hasher.run
+      sleep 0.01
+      hasher.raise(RuntimeError, "stop")
+      _{ hasher.join }.must_raise RuntimeError
+      _(d.hexdigest).must_equal Digest::KangarooTwelve[32].hexdigest("abc")
+    end
+  end
+
+  it "has a k12sum command that produces and checks checksums" do
+    k12sum = [RbConfig.ruby, "-I", File.expand_path('../../lib', __FILE__), File.expand_path('../../bin/k12sum', __FILE__)]
+
+    Tempfile.create("kangarootwelve") do |f|
+      f.write(get_repeated_0x00_to_0xfa(17 ** 4))
+      f.close
+      sums = IO.popen(k12sum + [f.path], &:read)
+      _(sums).must_equal "#{Digest::KangarooTwelve[32].hexdigest(File.binread(f.path))}  #{f.path}\n"
+      _(IO.popen(k12sum + ["-c", "-"], "r+"){ |io| io.write(sums); io.close_write; io.read }).must_equal "#{f.path}: OK\n"
+      _($?.success?).must_equal true
+      _(IO.popen(k12sum + ["-l", "48", "-C", "abcd", f.path], &:read).split.first).must_equal Digest::KangarooTwelve.implement(name: nil, digest_length: 48, customization: "abcd").hexdigest(File.binread(f.path))
+      bad = "#{'0' * 64}  bad\0name\n"
+      output = IO.popen(k12sum + ["-c", "-"], "r+", err: File::NULL){ |io| io.write(bad + sums); io.close_write; io.read }
+      _(output).must_equal "bad\0name: FAILED open or read\n#{f.path}: OK\n"
+      _($?.exitstatus).must_equal 1
+    end
+  end
+
+  it "counts the bytes read from FIFOs in k12sum statistics" do
+    skip "FIFOs are not supported" unless File.respond_to?(:mkfifo)
+    k12sum = [RbConfig.ruby, "-I", File.expand_path('../../lib', __FILE__), File.expand_path('../../bin/k12sum', __FILE__)]
+
+    Dir.mktmpdir do |dir|
+      path = File.join(dir, "fifo")
+      File.mkfifo(path)
+      data = get_repeated_0x00_to_0xfa(100_000)
+      writer = Thread.new{ File.binwrite(path, data) }
+      output = IO.popen(k12sum + ["--stats", path], err: [:child, :out], &:read)
+      writer.join
+      _(output).must_include "#{Digest::KangarooTwelve[32].hexdigest(data)}  #{path}\n"
+      _(output).must_include "1 file(s), 100000 bytes"
+    end
+  end
+
+  it "produces digests of objects from their canonical encoding" do
+    obj = { "name" => "k12", :list => [1, -2, 2 ** 70, -(2 ** 70), 0, 1.5, nil, true, false],
+            3 => { :nested => ["x" * 300] }, "empty" => [{}, [], ""] }
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd")
+    _(klass.digest_object(obj)).must_equal klass.digest(encode_object(obj))
+    _(Digest::KangarooTwelve[48].digest_object(obj)).must_equal Digest::KangarooTwelve[48].digest(encode_object(obj))
+  end
+
+  it "produces object digests that are independent of hash ordering but sensitive to types" do
+    klass = Digest::KangarooTwelve[32]
+    _(klass.digest_object({ a: 1, b: 2 })).must_equal klass.digest_object({ b: 2, a: 1 })
+    digests = [[1], ["1"], [1.0], [:"1"], [[1]], [{ 1 => nil }], [nil], [1, nil]].map{ |e| klass.digest_object(e) }
+    _(digests.uniq.size).must_equal digests.size
+    _{ klass.digest_object(Object.new) }.must_raise TypeError
+    a = []; a << a
+    _{ klass.digest_object(a) }.must_raise ArgumentError
+  end
+
+  it "caches digests of frozen strings when the digest cache is enabled" do
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd")
+    _(klass.digest_cache_stats).must_be_nil
+    _(klass.enable_digest_cache(1024)).must_equal klass
+    frozen, mutable = "abc".freeze, +"abc"
+    expected = Digest::KangarooTwelve.implement(name: nil, digest_length: 32, customization: "abcd").digest("abc")
+    2.times{ _(klass.digest(frozen)).must_equal expected }
+    _(klass.hexdigest(frozen)).must_equal expected.unpack1('H*')
+    _(klass.digest(mutable)).must_equal expected
+    stats = klass.digest_cache_stats
+    _([stats[:hits], stats[:misses], stats[:entries]]).must_equal [2, 1, 1]
+    strings = 100.times.map{ |i| i.to_s.freeze }
+    strings.each{ |s| klass.digest(s) }
+    _(klass.digest_cache_stats[:bytes]).must_be :<=, 1024
+    _(klass.digest_cache_stats[:entries]).must_be :<, 100
+    _(klass.digest(strings.last)).must_equal klass.digest(strings.last.dup)
+    _(klass.digest(strings.last.dup.freeze)).must_equal klass.digest(strings.last)
+    _(klass.clear_digest_cache.digest_cache_stats.values_at(:hits, :misses, :entries, :bytes)).must_equal [0, 0, 0, 0]
+    klass.disable_digest_cache
+    _(klass.digest_cache_stats).must_be_nil
+  end
+
+  it "drops digest cache entries once their strings are garbage-collected" do
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32)
+    klass.enable_digest_cache(1 << 20)
+    kept = "kept".dup.freeze
+    klass.digest(kept)
+    50.times{ |i| klass.digest("#{i}".freeze) }
+    _(klass.digest_cache_stats[:entries]).must_equal 51
+    GC.start
+    GC.start
+    _(klass.digest_cache_stats[:entries]).must_be :<, 51
+    _(klass.digest(kept)).must_equal klass.digest(kept.dup)
+    _(klass.digest_cache_stats[:hits]).must_equal 1
+  end
+
+  it "keeps the digest cache consistent while garbage collection drops its strings" do
+    klass = Digest::KangarooTwelve.implement(name: nil, digest_length: 32)
+    klass.enable_digest_cache(100 * 1024)
+    expected = 300.times.map{ |i| Digest::KangarooTwelve[32].digest("x#{i}" * 3) }
+
+    30_000.times do |i|
+      _(klass.digest(("x#{i % 300}" * 3).freeze)).must_equal expected[i % 300]
+      GC.start if i % 1000 == 0
+    end
+
+    stats = klass.digest_cache_stats
+    _(stats[:bytes]).must_be :<=, 100 * 1024
+    _(stats[:hits] + stats[:misses]).must_equal 30_000
+    GC.start
+    _(klass.digest_cache_stats[:entries]).must_be :<, 1000
+    klass.disable_digest_cache
+    GC.start
+  end
+
   it "must have VERSION constant" do
     _(Digest::KangarooTwelve.constants).must_include :VERSION
   end